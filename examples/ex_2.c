@@ -0,0 +1,371 @@
+/*
+ * Streams sensor readings to stdout as InfluxDB line protocol, or JSON lines
+ * with -j. Output is formatted by hand into one large buffer that is reused
+ * for every sample, and flushed with a single write() when it fills up or
+ * every few seconds, so this keeps up with fast sample rates (see -i).
+ * Sensors that can't be read are left out rather than reported as zero.
+ * Stops cleanly, flushing what is buffered, on SIGINT or SIGTERM.
+ *
+ * With -p, instead renders the Prometheus text exposition format once per
+ * sample and atomically replaces the given file with it, for the node_exporter
+ * textfile collector. Scrapes then just read the pre-rendered file.
+ *
+ * Usage: ex_2 [-j | -p file.prom] [-n samples] [-i interval_ms]
+ *
+ * ex_2.c
+ * libsmc
+ *
+ * Copyright (C) 2014  beltex <https://github.com/beltex>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/smc.h"
+
+
+#define BUF_SIZE       (64 * 1024)
+#define MAX_LINE       128
+#define MAX_PREFIX     64
+#define FLUSH_INTERVAL 5
+#define PROM_HEADER    "# TYPE smc_temperature_celsius gauge\n"
+
+
+static const char *const tmp_keys[] = {
+    CPU_0_DIODE,
+    CPU_0_PROXIMITY,
+    GPU_0_DIODE,
+    GPU_0_PROXIMITY,
+    AMBIENT_AIR_0
+};
+
+#define NUM_TMP_KEYS (sizeof(tmp_keys) / sizeof(tmp_keys[0]))
+
+
+static char   buf[BUF_SIZE];
+static size_t buf_len = 0;
+
+
+/**
+Cleared by SIGINT/SIGTERM to end the sample loop
+*/
+static volatile sig_atomic_t running = 1;
+
+
+/**
+Everything in front of the value, built once per key.
+*/
+static char   prefixes[NUM_TMP_KEYS][MAX_PREFIX];
+static size_t prefix_lens[NUM_TMP_KEYS];
+
+
+static void stop(int sig)
+{
+    running = 0;
+}
+
+
+/**
+Write out the buffer and empty it. A signal arriving mid write is retried, so
+Ctrl-C never costs buffered lines.
+
+:returns: True if the whole buffer was written, false on a write error
+*/
+static bool flush(int fd)
+{
+    size_t off = 0;
+    bool   ans = true;
+
+    while (off < buf_len) {
+        ssize_t n = write(fd, buf + off, buf_len - off);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            ans = false;
+            break;
+        }
+
+        off += n;
+    }
+
+    buf_len = 0;
+
+    return ans;
+}
+
+
+static void append(const char *str, size_t len)
+{
+    memcpy(buf + buf_len, str, len);
+    buf_len += len;
+}
+
+
+static void append_uint(unsigned long long val)
+{
+    char tmp[20];
+    int  i = sizeof(tmp);
+
+    do {
+        tmp[--i] = '0' + (val % 10);
+        val /= 10;
+    } while (val != 0);
+
+    append(tmp + i, sizeof(tmp) - i);
+}
+
+
+/**
+Append with two decimal places, which is all the precision an sp78 value has
+*/
+static void append_fixed2(double val)
+{
+    if (val < 0) {
+        append("-", 1);
+        val = -val;
+    }
+
+    unsigned long long hundredths = (unsigned long long)(val * 100 + 0.5);
+    char frac[3] = { '.', '0' + (hundredths / 10) % 10, '0' + hundredths % 10 };
+
+    append_uint(hundredths / 100);
+    append(frac, sizeof(frac));
+}
+
+
+static void build_prefixes(bool json, bool prom)
+{
+    char *format = "smc,key=%s tmp=";
+
+    if (prom) {
+        format = "smc_temperature_celsius{key=\"%s\"} ";
+    } else if (json) {
+        format = "{\"key\":\"%s\",\"tmp\":";
+    }
+
+    for (unsigned int i = 0; i < NUM_TMP_KEYS; i++) {
+        prefix_lens[i] = snprintf(prefixes[i], MAX_PREFIX, format,
+                                  tmp_keys[i]);
+    }
+}
+
+
+static void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-j | -p file.prom] [-n samples] "
+                    "[-i interval_ms]\n", name);
+}
+
+
+/**
+Parse a whole, positive number option argument.
+
+:returns: The number, or zero if it isn't one
+*/
+static long parse_positive(char *arg)
+{
+    char *end;
+
+    errno = 0;
+    long ans = strtol(arg, &end, 10);
+
+    if (errno != 0 || end == arg || *end != '\0' || ans <= 0) {
+        return 0;
+    }
+
+    return ans;
+}
+
+
+/**
+Replace the file at path with the buffer. Written to a temporary file first and
+renamed over, so a reader never sees a partial exposition. If the write fails,
+the last good file is left as it is.
+*/
+static void write_exposition(char *path, char *tmp_path)
+{
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        buf_len = 0;
+        return;
+    }
+
+    bool written = flush(fd);
+
+    if (close(fd) != 0) {
+        written = false;
+    }
+
+    if (written) {
+        rename(tmp_path, path);
+    } else {
+        unlink(tmp_path);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    char *prom_path = NULL;
+    char prom_tmp_path[PATH_MAX];
+    long samples = -1;
+    long interval_ms = 1000;
+    struct timespec interval;
+    struct sigaction sa;
+    double tmps[NUM_TMP_KEYS];
+    struct timeval now;
+    time_t last_flush = 0;
+    int status = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ji:n:p:")) != -1) {
+        switch (opt) {
+            case 'j':
+                json = true;
+                break;
+            case 'p':
+                prom_path = optarg;
+                snprintf(prom_tmp_path, sizeof(prom_tmp_path), "%s.tmp",
+                         prom_path);
+                break;
+            case 'n':
+                samples = parse_positive(optarg);
+                break;
+            case 'i':
+                interval_ms = parse_positive(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+
+        // A zero or garbage interval would poll the SMC as fast as it can
+        if (samples == 0 || interval_ms == 0) {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (json && prom_path != NULL) {
+        fprintf(stderr, "%s: -j and -p can't be used together\n", argv[0]);
+        return -1;
+    }
+
+    interval.tv_sec  = interval_ms / 1000;
+    interval.tv_nsec = (interval_ms % 1000) * 1000000;
+
+    // No SA_RESTART, so a signal also cuts the sleep between samples short
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (open_smc() != kIOReturnSuccess) {
+        return -1;
+    }
+
+    build_prefixes(json, prom_path != NULL);
+
+    for (long s = 0; running && (samples < 0 || s < samples); s++) {
+        get_tmps(tmp_keys, NUM_TMP_KEYS, CELSIUS, tmps);
+        gettimeofday(&now, NULL);
+
+        unsigned long long ns = now.tv_sec * 1000000000ULL +
+                                now.tv_usec * 1000ULL;
+
+        if (prom_path != NULL) {
+            append(PROM_HEADER, sizeof(PROM_HEADER) - 1);
+
+            for (unsigned int i = 0; i < NUM_TMP_KEYS; i++) {
+                if (isnan(tmps[i])) {
+                    continue;
+                }
+
+                append(prefixes[i], prefix_lens[i]);
+                append_fixed2(tmps[i]);
+                append("\n", 1);
+            }
+
+            write_exposition(prom_path, prom_tmp_path);
+            nanosleep(&interval, NULL);
+            continue;
+        }
+
+        for (unsigned int i = 0; i < NUM_TMP_KEYS; i++) {
+            // Sensor not on this machine, or failed to read
+            if (isnan(tmps[i])) {
+                continue;
+            }
+
+            if (buf_len + MAX_PREFIX + MAX_LINE > BUF_SIZE &&
+                !flush(STDOUT_FILENO)) {
+                perror("write");
+                status = -1;
+                running = 0;
+                break;
+            }
+
+            append(prefixes[i], prefix_lens[i]);
+            append_fixed2(tmps[i]);
+
+            if (json) {
+                append(",\"time\":", 8);
+                append_uint(ns);
+                append("}\n", 2);
+            } else {
+                append(" ", 1);
+                append_uint(ns);
+                append("\n", 1);
+            }
+        }
+
+        if (now.tv_sec - last_flush >= FLUSH_INTERVAL) {
+            if (!flush(STDOUT_FILENO)) {
+                // Reader is gone or out of space - nothing to keep going for
+                perror("write");
+                status = -1;
+                break;
+            }
+
+            last_flush = now.tv_sec;
+        }
+
+        nanosleep(&interval, NULL);
+    }
+
+    if (!flush(STDOUT_FILENO)) {
+        perror("write");
+        status = -1;
+    }
+
+    close_smc();
+
+    return status;
+}
@@ -0,0 +1,78 @@
+/*
+ * Dumps every key the SMC has, one per line, as tab separated key, data type,
+ * data size and raw bytes in hex ("-" for keys whose value can't be read).
+ * Redirect to a file to capture a full key list of a machine, with types,
+ * sizes and a snapshot of values.
+ *
+ * ex_3.c
+ * libsmc
+ *
+ * Copyright (C) 2014  beltex <https://github.com/beltex>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include "../include/smc.h"
+
+int main()
+{
+    io_name_t  model;
+    smc_key_t  key;
+    raw_data_t raw;
+    char       data_type[5];
+    uint32_t   data_size;
+
+    if (open_smc() != kIOReturnSuccess) {
+        return -1;
+    }
+
+    get_machine_model(model);
+    unsigned int num_keys = get_num_keys();
+
+    printf("# %s, %u keys\n", model, num_keys);
+
+    for (unsigned int i = 0; i < num_keys; i++) {
+        if (!get_key_at_index(i, key)) {
+            continue;
+        }
+
+        // Some keys can't be read (write only for example), still list them
+        // with their type and size, only the value is unavailable
+        if (!get_raw_data(key, &raw)) {
+            if (get_key_type(key, data_type, &data_size)) {
+                printf("%s\t%s\t%u\t-\n", key, data_type, data_size);
+            } else {
+                printf("%s\t-\t-\t-\n", key);
+            }
+
+            continue;
+        }
+
+        printf("%s\t%s\t%u\t", key, raw.data_type, raw.data_size);
+
+        // The size is whatever the SMC reports, don't trust it past our buffer
+        for (unsigned int j = 0; j < raw.data_size && j < sizeof(raw.data);
+             j++) {
+            printf("%02x", raw.data[j]);
+        }
+
+        printf("\n");
+    }
+
+    close_smc();
+
+    return 0;
+}
@@ -34,9 +34,19 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#ifndef SMC_H
+#define SMC_H
+
+#include <stdbool.h>
+#include <stdint.h>
 #include <IOKit/IOKitLib.h>
 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
 //------------------------------------------------------------------------------
 // MARK: MACROS
 //------------------------------------------------------------------------------
@@ -140,6 +150,65 @@ Sources: See TMP SMC keys
 typedef char fan_name_t[13];
 
 
+/**
+An SMC key as a null terminated string, e.g. "TC0D"
+*/
+typedef char smc_key_t[5];
+
+
+/**
+Undecoded value of an SMC key, exactly as returned by the SMC. Useful for
+storing or forwarding samples without losing anything to conversion.
+
+- data      : Raw bytes, only the first data_size are meaningful
+- data_type : Data type of the key, e.g. "sp78", null terminated
+- data_size : Number of bytes in data
+*/
+typedef struct {
+    uint8_t  data[32];
+    char     data_type[5];
+    uint32_t data_size;
+} raw_data_t;
+
+
+/**
+Running totals of calls made into the SMC since the library was loaded. See
+get_smc_stats().
+
+- reads     : Key reads
+- writes    : Key writes, e.g. from set_fan_min_rpm()
+- key_info  : Key info lookups (not served from the key info cache)
+- key_index : Key lookups by index, e.g. from get_key_at_index()
+- errors    : Calls of any kind that failed at the I/O Kit level
+*/
+typedef struct {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t key_info;
+    uint64_t key_index;
+    uint64_t errors;
+} smc_stats_t;
+
+
+/**
+Called after every call into the SMC when tracing is enabled. See
+set_smc_trace_callback().
+
+- key      : SMC key the call was for, as passed to the SMC
+- selector : SMC function that was called (read, write, get key info, ...)
+- start    : mach_absolute_time() when the call was issued
+- end      : mach_absolute_time() when the call returned
+- result   : Raw I/O Kit return code of the call
+- context  : Pointer given to set_smc_trace_callback()
+*/
+typedef void (*smc_trace_callback_t)(uint32_t      key,
+                                     uint8_t       selector,
+                                     uint64_t      start,
+                                     uint64_t      end,
+                                     kern_return_t result,
+                                     void          *context);
+
+
 //------------------------------------------------------------------------------
 // MARK: ENUMS
 //------------------------------------------------------------------------------
@@ -173,15 +242,106 @@ Close connection to the SMC
 kern_return_t close_smc(void);
 
 
+/**
+Get the model name of the machine, e.g. "MacBookPro11,1". Handy as a key for
+anything learned about or stored per machine type, as sensors, fans and their
+behaviour differ between models.
+
+:param: model The model name. Return will be empty on error.
+:returns: kIOReturnSuccess on success.
+*/
+kern_return_t get_machine_model(io_name_t model);
+
+
+/**
+Get the number of calls made into the SMC so far. Cheap enough to poll, for
+example to work out how many fan writes a control loop makes per minute.
+
+:param: stats Where to place the totals
+*/
+void get_smc_stats(smc_stats_t *stats);
+
+
+/**
+Set a callback to be invoked after every call into the SMC, for example to
+record calls into a trace buffer. Only has an effect when libsmc was built with
+-DSMC_TRACE, otherwise the trace hooks are compiled out entirely.
+
+The callback runs on the calling thread, right after the call returns, so keep
+it short.
+
+:param: callback Function to call, or NULL to stop tracing
+:param: context Passed through to the callback untouched
+*/
+void set_smc_trace_callback(smc_trace_callback_t callback, void *context);
+
+
+/**
+Convert mach_absolute_time() ticks, as passed to the trace callback, to
+nanoseconds. The timebase is looked up once and cached, so this is cheap enough
+to call per event.
+
+:param: ticks Value or difference of values from mach_absolute_time()
+:returns: The same duration in nanoseconds
+*/
+uint64_t trace_ticks_to_ns(uint64_t ticks);
+
+
 /**
 Check if an SMC key is valid. Useful for determining if a certain machine has
 particular sensor or fan for example.
 
+This only checks that the key exists, it does not read it. Some keys exist
+but can't be read (write only keys for example), and are still valid.
+
 :param: key The SMC key to check. 4 byte multi-character constant. Must be 4
             characters in length.
-:returns: True if the key is found, false otherwise
+:returns: True if the key exists, false otherwise
 */
-bool is_key_valid(char *key);
+bool is_key_valid(const char *key);
+
+
+/**
+Get the data type and size of an SMC key, without reading its value. Works for
+keys that can't be read as well.
+
+:param: key The SMC key
+:param: data_type Data type of the key, e.g. "sp78", null terminated. Room for
+                  5 chars. Return will be empty on error.
+:param: data_size Number of bytes in the key's value. Zero on error.
+:returns: True if successful, false otherwise
+*/
+bool get_key_type(const char *key, char data_type[5], uint32_t *data_size);
+
+
+/**
+Read the raw, undecoded value of any SMC key.
+
+:param: key The SMC key to read
+:param: raw Where to place the value. Zeroed on error.
+:returns: True if successful, false otherwise
+*/
+bool get_raw_data(const char *key, raw_data_t *raw);
+
+
+/**
+Get the number of keys the SMC has. Together with get_key_at_index() this
+allows discovering every key on the machine, e.g. all temperature sensors (keys
+starting with 'T').
+
+:returns: The number of keys. If an error occurs, return will be zero.
+*/
+unsigned int get_num_keys(void);
+
+
+/**
+Get the key at an index in the SMC's key table.
+
+:param: index Index of the key, from 0 to get_num_keys() - 1
+:param: key The key. Return will be empty on error.
+:returns: True if successful, false otherwise.
+*/
+bool get_key_at_index(unsigned int index, smc_key_t key);
 
 
 /**
@@ -192,7 +352,23 @@ Get the current temperature from a sensor
 :returns: Temperature of sensor. If the sensor is not found, or an error
           occurs, return will be zero
 */
-double get_tmp(char *key, tmp_unit_t unit);
+double get_tmp(const char *key, tmp_unit_t unit);
+
+
+/**
+Get the current temperature from several sensors at once, written straight into
+a caller provided array. Handy for filling one column of a table per sample.
+
+:param: keys The temperature sensors to read from
+:param: count Number of keys, and size of tmps
+:param: unit The unit for the temperature values.
+:param: tmps Where to place the temperatures, in the same order as keys.
+             Entries for sensors that are not found, or that error, are NAN
+             (check with isnan()).
+:returns: Number of sensors read successfully
+*/
+unsigned int get_tmps(const char *const keys[], unsigned int count,
+                      tmp_unit_t unit, double *tmps);
 
 
 /**
@@ -239,6 +415,39 @@ Get the current speed (RPM - revolutions per minute) of a fan.
 UInt get_fan_rpm(UInt fan_num);
 
 
+/**
+Get the minimum speed (RPM - revolutions per minute) currently set for a fan.
+See set_fan_min_rpm().
+
+:param: fan_num The number of the fan to check
+:returns: The fan's min RPM. If the fan is not found, or an error occurs,
+          return will be zero
+*/
+unsigned int get_fan_min_rpm(unsigned int fan_num);
+
+
+/**
+Get the maximum speed (RPM - revolutions per minute) a fan is rated for.
+
+:param: fan_num The number of the fan to check
+:returns: The fan's max RPM. If the fan is not found, or an error occurs,
+          return will be zero
+*/
+unsigned int get_fan_max_rpm(unsigned int fan_num);
+
+
+/**
+Get the speed (RPM - revolutions per minute) the SMC is currently driving a fan
+towards. This leads the actual speed, which lags behind while the fan spins up
+or down.
+
+:param: fan_num The number of the fan to check
+:returns: The fan's target RPM. If the fan is not found, or an error occurs,
+          return will be zero
+*/
+unsigned int get_fan_target_rpm(unsigned int fan_num);
+
+
 /**
 Set the minimum speed (RPM - revolutions per minute) of a fan. This method
 requires root privileges. By minimum we mean that OS X can interject and
@@ -247,8 +456,18 @@ raise the fan speed if needed, however it will not go below this.
 WARNING: You are playing with hardware here, BE CAREFUL.
 
 :param: fan_num The number of the fan to set
-:param: rpm The speed you would like to set the fan to.
+:param: rpm The speed you would like to set the fan to. Must not be above the
+            max RPM the fan reports (F0Mx for fan 0 for example).
 :param: auth Should the function do authentication?
-:return: True if successful, false otherwise
+:return: True if successful, false otherwise. False without writing anything if
+         rpm is above the fan's max, or if the fan's max can't be read (e.g.
+         no such fan).
 */
 bool set_fan_min_rpm(unsigned int fan_num, unsigned int rpm, bool auth);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SMC_H */
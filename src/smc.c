@@ -34,8 +34,11 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <mach/mach_time.h>
 #include "../include/smc.h"
 
 
@@ -74,6 +77,29 @@ http://stackoverflow.com/questions/22160746/fpe2-and-sp78-data-types
 #define DATA_TYPE_SP78   "sp78"
 
 
+/**
+Trace hooks around every call into the SMC. Only compiled in when building with
+-DSMC_TRACE, otherwise they expand to nothing and cost nothing.
+
+TRACE_SNAPSHOT must be used while holding conn_lock, so the callback and
+context that TRACE_END hands the call to always belong together.
+*/
+#ifdef SMC_TRACE
+#define TRACE_BEGIN(start) uint64_t             start = mach_absolute_time(); \
+                           smc_trace_callback_t start##_callback;             \
+                           void                 *start##_context
+#define TRACE_SNAPSHOT(start) start##_callback = trace_callback; \
+                              start##_context  = trace_context
+#define TRACE_END(start, input, result) trace_call(start, start##_callback,   \
+                                                   start##_context, input,    \
+                                                   result)
+#else
+#define TRACE_BEGIN(start)
+#define TRACE_SNAPSHOT(start)
+#define TRACE_END(start, input, result)
+#endif
+
+
 //------------------------------------------------------------------------------
 // MARK: GLOBAL VARS
 //------------------------------------------------------------------------------
@@ -85,6 +111,56 @@ Our connection to the SMC
 static io_connect_t conn;
 
 
+/**
+Between a successful open_smc() and close_smc(). We only ever reconnect on our
+own while this is set, so a call made before open_smc() or after close_smc()
+fails rather than quietly opening a connection nobody will close.
+*/
+static bool is_open = false;
+
+
+/**
+Guards conn. Calls into the SMC can come from any thread (say a UI override
+and a fan control loop both setting fan speeds), so all use of the connection
+is serialized through here.
+*/
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+Set in a forked child that inherited an open connection. Mach port rights are
+not inherited across fork(), so the child has to open its own on first use.
+*/
+static bool reopen_after_fork = false;
+
+
+/**
+For registering the fork handlers only once
+*/
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+
+/**
+Call totals. Guarded by conn_lock. See get_smc_stats().
+*/
+static smc_stats_t stats;
+
+
+/**
+User trace callback and its context. See set_smc_trace_callback().
+*/
+static smc_trace_callback_t trace_callback = NULL;
+static void                 *trace_context  = NULL;
+
+
+/**
+Timebase for converting mach_absolute_time() ticks to nanoseconds. Looked up
+once, it does not change while the machine is up.
+*/
+static mach_timebase_info_data_t timebase;
+static pthread_once_t            timebase_once = PTHREAD_ONCE_INIT;
+
+
 /**
 Number of characters in an SMC key
 */
@@ -199,6 +275,16 @@ typedef struct {
 } SMCParamStruct;
 
 
+/**
+Entry in the key info cache. See get_key_info().
+*/
+typedef struct {
+    uint32_t       key;
+    SMCKeyInfoData keyInfo;
+    uint32_t       lastUsed;
+} key_info_t;
+
+
 /**
 Used for returning data from the SMC.
 */
@@ -210,6 +296,35 @@ typedef struct {
 } smc_return_t;
 
 
+//------------------------------------------------------------------------------
+// MARK: KEY INFO CACHE
+//------------------------------------------------------------------------------
+
+
+/**
+Shape of the key info cache - a 4-way set associative table, 256 entries in
+all. Fixed, so the cache costs the same small amount of memory no matter how
+many keys are read.
+
+Keys are hashed to a set, and a miss replaces the entry in its set that was
+used least recently. So a one off pass over every key (enumerating, or a full
+dump) can only push the keys a client polls out until their next read, rather
+than keeping them out of the cache for good.
+*/
+#define KEY_INFO_CACHE_SETS 64
+#define KEY_INFO_CACHE_WAYS 4
+
+
+/**
+Empty entries have key 0, which is never a valid key (see to_uint32_t()).
+key_info_cache_clock is bumped on every use, entries keep the value from their
+last use. Wrapping around only costs a poor choice of victim once.
+*/
+static key_info_t      key_info_cache[KEY_INFO_CACHE_SETS][KEY_INFO_CACHE_WAYS];
+static uint32_t        key_info_cache_clock = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
 //------------------------------------------------------------------------------
 // MARK: HELPERS - TYPE CONVERSION
 //------------------------------------------------------------------------------
@@ -226,15 +341,30 @@ static unsigned int from_fpe2(uint8_t data[32])
     unsigned int ans = 0;
 
     // Data type for fan calls - fpe2
-    // This is assumend to mean floating point, with 2 exponent bits
+    // Unsigned fixed point, 14 integer bits and 2 fraction bits, big endian.
+    // The fraction is dropped.
     // http://stackoverflow.com/questions/22160746/fpe2-and-sp78-data-types
     ans += data[0] << 6;
-    ans += data[1] << 2;
+    ans += data[1] >> 2;
 
     return ans;
 }
 
 
+/**
+Convert data from SMC of ui32 type to human readable.
+
+:param: data Data from the SMC to be converted. Assumed data size of 4.
+:returns: Converted data
+*/
+static uint32_t from_ui32(uint8_t data[32])
+{
+    // Big endian
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+           ((uint32_t)data[2] << 8)  |  (uint32_t)data[3];
+}
+
+
 /**
 Convert to fpe2 data type to be passed to SMC.
 
@@ -248,6 +378,23 @@ static void to_fpe2(unsigned int val, uint8_t *data)
 }
 
 
+/**
+Convert data from SMC of sp78 type to human readable.
+
+:param: data Data from the SMC to be converted. Assumed data size of 2.
+:returns: Converted data
+*/
+static double from_sp78(uint8_t data[32])
+{
+    // Data type for temperature calls - sp78
+    // Signed fixed point, 7 integer bits and 8 fraction bits, big endian
+    // http://stackoverflow.com/questions/22160746/fpe2-and-sp78-data-types
+    int16_t raw = (int16_t)((data[0] << 8) | data[1]);
+
+    return raw / 256.0;
+}
+
+
 /**
 Convert SMC key to uint32_t. This must be done to pass it to the SMC.
 
@@ -255,7 +402,7 @@ Convert SMC key to uint32_t. This must be done to pass it to the SMC.
 :returns: uint32_t translation.
           Returns zero if key is not 4 characters in length.
 */
-static uint32_t to_uint32_t(char *key)
+static uint32_t to_uint32_t(const char *key)
 {
     uint32_t ans   = 0;
     uint32_t shift = 24;
@@ -291,6 +438,15 @@ static void to_string(uint32_t val, char *dataType)
 }
 
 
+/**
+Look up the mach timebase. For use with pthread_once().
+*/
+static void init_timebase(void)
+{
+    mach_timebase_info(&timebase);
+}
+
+
 //------------------------------------------------------------------------------
 // MARK: HELPERS - TMP CONVERSION
 //------------------------------------------------------------------------------
@@ -316,11 +472,132 @@ static double to_kelvin(double tmp)
 }
 
 
+/**
+Celsius to the given unit
+*/
+static double convert_tmp(double tmp, tmp_unit_t unit)
+{
+    switch (unit) {
+        case CELSIUS:
+            break;
+        case FAHRENHEIT:
+            tmp = to_fahrenheit(tmp);
+            break;
+        case KELVIN:
+            tmp = to_kelvin(tmp);
+            break;
+    }
+
+    return tmp;
+}
+
+
 //------------------------------------------------------------------------------
 // MARK: "PRIVATE" FUNCTIONS
 //------------------------------------------------------------------------------
 
 
+/**
+Check if an I/O Kit return code means our connection to the SMC is no longer
+usable. This is what we see after a sleep/wake cycle, when the kext has dropped
+the user client out from under us.
+
+:param: result Raw I/O Kit return code (before err_get_code())
+:returns: True if the connection should be reopened, false otherwise
+*/
+static bool is_connection_stale(kern_return_t result)
+{
+    return result == kIOReturnNotOpen       ||
+           result == kIOReturnNotResponding ||
+           result == MACH_SEND_INVALID_DEST;
+}
+
+
+/**
+Open a connection to the SMC. Caller must hold conn_lock.
+
+:returns: kIOReturnSuccess on successful connection to the SMC.
+*/
+static kern_return_t open_connection(void)
+{
+    kern_return_t result;
+    io_service_t service;
+
+    service = IOServiceGetMatchingService(kIOMasterPortDefault,
+                                          IOServiceMatching(IOSERVICE_SMC));
+
+    if (service == 0) {
+        // NOTE: IOServiceMatching documents 0 on failure
+        printf("ERROR: %s NOT FOUND\n", IOSERVICE_SMC);
+        return kIOReturnError;
+    }
+
+    result = IOServiceOpen(service, mach_task_self(), 0, &conn);
+    IOObjectRelease(service);
+
+    return result;
+}
+
+
+/**
+pthread_atfork() handlers. Hold conn_lock across the fork so the child never
+inherits it mid-call, and have the child drop the connection it cannot use.
+*/
+static void atfork_prepare(void)
+{
+    pthread_mutex_lock(&conn_lock);
+    pthread_mutex_lock(&cache_lock);
+}
+
+
+static void atfork_parent(void)
+{
+    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&conn_lock);
+}
+
+
+static void atfork_child(void)
+{
+    // Not ours to close - the port name means nothing in this task
+    if (conn != 0) {
+        conn = 0;
+        reopen_after_fork = true;
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&conn_lock);
+}
+
+
+static void register_atfork(void)
+{
+    pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+}
+
+
+#ifdef SMC_TRACE
+/**
+Hand a finished SMC call over to the user trace callback, if any.
+
+:param: start mach_absolute_time() at the start of the call
+:param: callback Trace callback, as read under conn_lock
+:param: context Trace context, as read under conn_lock
+:param: input Struct that was passed to the SMC
+:param: result I/O Kit return code of the call
+*/
+static void trace_call(uint64_t start, smc_trace_callback_t callback,
+                       void *context, SMCParamStruct *input,
+                       kern_return_t result)
+{
+    if (callback != NULL) {
+        callback(input->key, input->data8, start, mach_absolute_time(), result,
+                 context);
+    }
+}
+#endif
+
+
 /**
 Make a call to the SMC
 
@@ -335,12 +612,64 @@ static kern_return_t call_smc(SMCParamStruct *inputStruct,
     size_t inputStructCnt  = sizeof(SMCParamStruct);
     size_t outputStructCnt = sizeof(SMCParamStruct);
 
+    TRACE_BEGIN(trace_start);
+    pthread_mutex_lock(&conn_lock);
+
+    if (reopen_after_fork) {
+        reopen_after_fork = false;
+        open_connection();
+    }
+
     result = IOConnectCallStructMethod(conn, kSMCHandleYPCEvent,
                                              inputStruct,
                                              inputStructCnt,
                                              outputStruct,
                                              &outputStructCnt);
 
+    if (is_open && is_connection_stale(result)) {
+        // Most likely the machine went to sleep and the AppleSMC user client
+        // went away with it. Rather than failing every call from here on,
+        // reopen the connection once and retry.
+        if (conn != 0) {
+            IOServiceClose(conn);
+        }
+
+        if (open_connection() != kIOReturnSuccess) {
+            // Don't keep calling on a dead port name, try again next call
+            conn = 0;
+        } else {
+            outputStructCnt = sizeof(SMCParamStruct);
+            result = IOConnectCallStructMethod(conn, kSMCHandleYPCEvent,
+                                                     inputStruct,
+                                                     inputStructCnt,
+                                                     outputStruct,
+                                                     &outputStructCnt);
+        }
+    }
+
+    switch (inputStruct->data8) {
+        case kSMCReadKey:
+            stats.reads++;
+            break;
+        case kSMCWriteKey:
+            stats.writes++;
+            break;
+        case kSMCGetKeyInfo:
+            stats.key_info++;
+            break;
+        case kSMCGetKeyFromIndex:
+            stats.key_index++;
+            break;
+    }
+
+    if (result != kIOReturnSuccess) {
+        stats.errors++;
+    }
+
+    TRACE_SNAPSHOT(trace_start);
+    pthread_mutex_unlock(&conn_lock);
+    TRACE_END(trace_start, inputStruct, result);
+
     if (result != kIOReturnSuccess) {
         // IOReturn error code lookup. See "Accessing Hardware From Applications
         // -> Handling Errors" Apple doc
@@ -351,14 +680,94 @@ static kern_return_t call_smc(SMCParamStruct *inputStruct,
 }
 
 
+/**
+Get the info (data size and type) of an SMC key. This never changes for a key,
+so once asked of the SMC it is kept in the key info cache. That turns later
+reads or writes of the key into a single call to the SMC rather than two, for
+as long as the key stays in the cache.
+
+:param: key The SMC key, as passed to the SMC
+:param: keyInfo Where to place the key info
+:param: kSMC Where to place the SMC return code
+:returns: I/O Kit return code
+*/
+static kern_return_t get_key_info(uint32_t key, SMCKeyInfoData *keyInfo,
+                                  kSMC_t *kSMC)
+{
+    kern_return_t result;
+    SMCParamStruct inputStruct;
+    SMCParamStruct outputStruct;
+
+    // Keys sharing a prefix like "TC0D" and "TC1D" differ in only a few bits,
+    // so mix them with a multiplicative (Fibonacci) hash before picking a set
+    unsigned int set = ((key * 2654435761u) >> 16) % KEY_INFO_CACHE_SETS;
+    key_info_t *ways = key_info_cache[set];
+
+    pthread_mutex_lock(&cache_lock);
+
+    for (unsigned int i = 0; key != 0 && i < KEY_INFO_CACHE_WAYS; i++) {
+        if (ways[i].key == key) {
+            *keyInfo = ways[i].keyInfo;
+            *kSMC    = kSMCSuccess;
+            ways[i].lastUsed = ++key_info_cache_clock;
+            pthread_mutex_unlock(&cache_lock);
+            return kIOReturnSuccess;
+        }
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+
+    memset(&inputStruct,  0, sizeof(SMCParamStruct));
+    memset(&outputStruct, 0, sizeof(SMCParamStruct));
+
+    inputStruct.key = key;
+    inputStruct.data8 = kSMCGetKeyInfo;
+
+    result = call_smc(&inputStruct, &outputStruct);
+    *kSMC = outputStruct.result;
+
+    if (result != kIOReturnSuccess || outputStruct.result != kSMCSuccess) {
+        return result;
+    }
+
+    *keyInfo = outputStruct.keyInfo;
+
+    // Replace the least recently used entry of the set, unless another thread
+    // got the key in while we were at the SMC
+    pthread_mutex_lock(&cache_lock);
+
+    unsigned int victim = 0;
+
+    for (unsigned int i = 0; i < KEY_INFO_CACHE_WAYS; i++) {
+        if (ways[i].key == key) {
+            victim = i;
+            break;
+        }
+
+        if (ways[i].lastUsed < ways[victim].lastUsed) {
+            victim = i;
+        }
+    }
+
+    ways[victim].key      = key;
+    ways[victim].keyInfo  = outputStruct.keyInfo;
+    ways[victim].lastUsed = ++key_info_cache_clock;
+
+    pthread_mutex_unlock(&cache_lock);
+
+    return result;
+}
+
+
 /**
 Read data from the SMC
 
 :param: key The SMC key
 */
-static kern_return_t read_smc(char *key, smc_return_t *result_smc)
+static kern_return_t read_smc(const char *key, smc_return_t *result_smc)
 {
     kern_return_t result;
+    SMCKeyInfoData keyInfo;
     SMCParamStruct inputStruct;
     SMCParamStruct outputStruct;
 
@@ -366,24 +775,22 @@ static kern_return_t read_smc(char *key, smc_return_t *result_smc)
     memset(&outputStruct, 0, sizeof(SMCParamStruct));
     memset(result_smc,    0, sizeof(smc_return_t));
 
-    // First call to AppleSMC - get key info
+    // First get key info - only a call to AppleSMC the first time round
     inputStruct.key = to_uint32_t(key);
-    inputStruct.data8 = kSMCGetKeyInfo;
 
-    result = call_smc(&inputStruct, &outputStruct);
-    result_smc->kSMC = outputStruct.result;
+    result = get_key_info(inputStruct.key, &keyInfo, &result_smc->kSMC);
 
-    if (result != kIOReturnSuccess || outputStruct.result != kSMCSuccess) {
+    if (result != kIOReturnSuccess || result_smc->kSMC != kSMCSuccess) {
         return result;
     }
 
     // Store data for return
-    result_smc->dataSize = outputStruct.keyInfo.dataSize;
-    result_smc->dataType = outputStruct.keyInfo.dataType;    
-    
+    result_smc->dataSize = keyInfo.dataSize;
+    result_smc->dataType = keyInfo.dataType;
 
-    // Second call to AppleSMC - now we can get the data
-    inputStruct.keyInfo.dataSize = outputStruct.keyInfo.dataSize;
+
+    // Call to AppleSMC - now we can get the data
+    inputStruct.keyInfo.dataSize = keyInfo.dataSize;
     inputStruct.data8 = kSMCReadKey;
 
     result = call_smc(&inputStruct, &outputStruct);
@@ -404,35 +811,34 @@ Write data to the SMC.
 
 :returns: IOReturn IOKit return code
 */
-static kern_return_t write_smc(char *key, smc_return_t *result_smc)
+static kern_return_t write_smc(const char *key, smc_return_t *result_smc)
 {
     kern_return_t result;
+    SMCKeyInfoData keyInfo;
     SMCParamStruct inputStruct;
     SMCParamStruct outputStruct;
 
     memset(&inputStruct,  0, sizeof(SMCParamStruct));
     memset(&outputStruct, 0, sizeof(SMCParamStruct));
 
-    // First call to AppleSMC - get key info
+    // First get key info - only a call to AppleSMC the first time round
     inputStruct.key = to_uint32_t(key);
-    inputStruct.data8 = kSMCGetKeyInfo;
 
-    result = call_smc(&inputStruct, &outputStruct);
-    result_smc->kSMC = outputStruct.result;
+    result = get_key_info(inputStruct.key, &keyInfo, &result_smc->kSMC);
 
-    if (result != kIOReturnSuccess || outputStruct.result != kSMCSuccess) {
+    if (result != kIOReturnSuccess || result_smc->kSMC != kSMCSuccess) {
         return result;
     }
 
     // Check data is correct
-    if (result_smc->dataSize != outputStruct.keyInfo.dataSize ||
-        result_smc->dataType != outputStruct.keyInfo.dataType) {
+    if (result_smc->dataSize != keyInfo.dataSize ||
+        result_smc->dataType != keyInfo.dataType) {
         return kIOReturnBadArgument;
     }
 
-    // Second call to AppleSMC - now we can write the data
+    // Call to AppleSMC - now we can write the data
     inputStruct.data8 = kSMCWriteKey;
-    inputStruct.keyInfo.dataSize = outputStruct.keyInfo.dataSize;
+    inputStruct.keyInfo.dataSize = keyInfo.dataSize;
 
     // Set data to write
     memcpy(inputStruct.bytes, result_smc->data, sizeof(result_smc->data));
@@ -445,27 +851,31 @@ static kern_return_t write_smc(char *key, smc_return_t *result_smc)
 
 
 /**
-Get the model name of the machine.
+Read one of the fpe2 RPM keys of a fan.
+
+:param: fan_num The number of the fan
+:param: suffix Which RPM key, e.g. "Ac" for actual or "Mx" for max
+:returns: The RPM. If the key is not found, or an error occurs, return will be
+          zero
 */
-static kern_return_t get_machine_model(io_name_t model)
+static unsigned int read_fan_rpm(unsigned int fan_num, const char *suffix)
 {
-    io_service_t  service;
+    char key[5];
     kern_return_t result;
-    
-    service = IOServiceGetMatchingService(kIOMasterPortDefault,
-                                          IOServiceMatching(IOSERVICE_MODEL));
-    
-    if (service == 0) {
-        printf("ERROR: %s NOT FOUND\n", IOSERVICE_MODEL);
-        return kIOReturnError;
-    }
+    smc_return_t  result_smc;
 
-    // Get the model name
-    result = IORegistryEntryGetName(service, model);
-    IOObjectRelease(service);
+    snprintf(key, sizeof(key), "F%d%s", fan_num, suffix);
+    result = read_smc(key, &result_smc);
 
-    return result;
-} 
+    if (!(result == kIOReturnSuccess &&
+          result_smc.dataSize == 2   &&
+          result_smc.dataType == to_uint32_t(DATA_TYPE_FPE2))) {
+        // Error
+        return 0;
+    }
+
+    return from_fpe2(result_smc.data);
+}
 
 
 //------------------------------------------------------------------------------
@@ -476,45 +886,106 @@ static kern_return_t get_machine_model(io_name_t model)
 kern_return_t open_smc(void)
 {
     kern_return_t result;
-    io_service_t service;
 
-    service = IOServiceGetMatchingService(kIOMasterPortDefault,
-                                          IOServiceMatching(IOSERVICE_SMC));
+    pthread_once(&atfork_once, register_atfork);
+
+    pthread_mutex_lock(&conn_lock);
+    reopen_after_fork = false;
+    result = open_connection();
+    is_open = (result == kIOReturnSuccess);
+    pthread_mutex_unlock(&conn_lock);
 
+    return result;
+}
+
+
+kern_return_t close_smc(void)
+{
+    kern_return_t result;
+
+    pthread_mutex_lock(&conn_lock);
+    result = IOServiceClose(conn);
+    conn = 0;
+    is_open = false;
+    reopen_after_fork = false;
+    pthread_mutex_unlock(&conn_lock);
+
+    return result;
+}
+
+
+kern_return_t get_machine_model(io_name_t model)
+{
+    io_service_t  service;
+    kern_return_t result;
+
+    model[0] = '\0';
+    
+    service = IOServiceGetMatchingService(kIOMasterPortDefault,
+                                          IOServiceMatching(IOSERVICE_MODEL));
+    
     if (service == 0) {
-        // NOTE: IOServiceMatching documents 0 on failure
-        printf("ERROR: %s NOT FOUND\n", IOSERVICE_SMC);
+        printf("ERROR: %s NOT FOUND\n", IOSERVICE_MODEL);
         return kIOReturnError;
     }
 
-    result = IOServiceOpen(service, mach_task_self(), 0, &conn);
+    // Get the model name
+    result = IORegistryEntryGetName(service, model);
     IOObjectRelease(service);
 
     return result;
 }
 
 
-kern_return_t close_smc(void)
+void get_smc_stats(smc_stats_t *stats_out)
 {
-    return IOServiceClose(conn);
+    pthread_mutex_lock(&conn_lock);
+    *stats_out = stats;
+    pthread_mutex_unlock(&conn_lock);
 }
 
 
-bool is_key_valid(char *key)
+void set_smc_trace_callback(smc_trace_callback_t callback, void *context)
+{
+    pthread_mutex_lock(&conn_lock);
+    trace_callback = callback;
+    trace_context  = context;
+    pthread_mutex_unlock(&conn_lock);
+}
+
+
+uint64_t trace_ticks_to_ns(uint64_t ticks)
+{
+    pthread_once(&timebase_once, init_timebase);
+
+    // 1:1 on Intel Macs, so this is usually free
+    if (timebase.numer == timebase.denom) {
+        return ticks;
+    }
+
+    // Split to avoid overflowing ticks * numer for large tick values
+    return (ticks / timebase.denom) * timebase.numer +
+           (ticks % timebase.denom) * timebase.numer / timebase.denom;
+}
+
+
+bool is_key_valid(const char *key)
 {
     bool ans = false;
-    kern_return_t result;
-    smc_return_t  result_smc;
+    kern_return_t  result;
+    kSMC_t         kSMC;
+    SMCKeyInfoData keyInfo;
 
     if (strlen(key) != SMC_KEY_SIZE) {
         printf("ERROR: Invalid key size - must be 4 chars\n");
         return ans;
     }
 
-    // Try a read and see if it succeeds
-    result = read_smc(key, &result_smc);
+    // The SMC only has info for keys that exist, so no need to read the value.
+    // Once cached, checking the same key again is free.
+    result = get_key_info(to_uint32_t(key), &keyInfo, &kSMC);
 
-    if (result == kIOReturnSuccess && result_smc.kSMC == kSMCSuccess) {
+    if (result == kIOReturnSuccess && kSMC == kSMCSuccess) {
         ans = true;
     }
 
@@ -522,7 +993,93 @@ bool is_key_valid(char *key)
 }
 
 
-double get_tmp(char *key, tmp_unit_t unit)
+bool get_key_type(const char *key, char data_type[5], uint32_t *data_size)
+{
+    kern_return_t  result;
+    kSMC_t         kSMC;
+    SMCKeyInfoData keyInfo;
+
+    memset(data_type, 0, 5);
+    *data_size = 0;
+
+    result = get_key_info(to_uint32_t(key), &keyInfo, &kSMC);
+
+    if (!(result == kIOReturnSuccess && kSMC == kSMCSuccess)) {
+        return false;
+    }
+
+    to_string(keyInfo.dataType, data_type);
+    *data_size = keyInfo.dataSize;
+
+    return true;
+}
+
+
+bool get_raw_data(const char *key, raw_data_t *raw)
+{
+    kern_return_t result;
+    smc_return_t  result_smc;
+
+    memset(raw, 0, sizeof(raw_data_t));
+
+    result = read_smc(key, &result_smc);
+
+    if (!(result == kIOReturnSuccess && result_smc.kSMC == kSMCSuccess)) {
+        return false;
+    }
+
+    memcpy(raw->data, result_smc.data, sizeof(raw->data));
+    to_string(result_smc.dataType, raw->data_type);
+    raw->data_size = result_smc.dataSize;
+
+    return true;
+}
+
+
+unsigned int get_num_keys(void)
+{
+    kern_return_t result;
+    smc_return_t  result_smc;
+
+    result = read_smc(NUM_KEYS, &result_smc);
+
+    if (!(result == kIOReturnSuccess &&
+          result_smc.dataSize == 4   &&
+          result_smc.dataType == to_uint32_t(DATA_TYPE_UINT32))) {
+        // Error
+        return 0;
+    }
+
+    return from_ui32(result_smc.data);
+}
+
+
+bool get_key_at_index(unsigned int index, smc_key_t key)
+{
+    kern_return_t result;
+    SMCParamStruct inputStruct;
+    SMCParamStruct outputStruct;
+
+    memset(&inputStruct,  0, sizeof(SMCParamStruct));
+    memset(&outputStruct, 0, sizeof(SMCParamStruct));
+    memset(key,           0, sizeof(smc_key_t));
+
+    inputStruct.data8  = kSMCGetKeyFromIndex;
+    inputStruct.data32 = index;
+
+    result = call_smc(&inputStruct, &outputStruct);
+
+    if (result != kIOReturnSuccess || outputStruct.result != kSMCSuccess) {
+        return false;
+    }
+
+    to_string(outputStruct.key, key);
+
+    return true;
+}
+
+
+double get_tmp(const char *key, tmp_unit_t unit)
 {
     kern_return_t result;
     smc_return_t  result_smc;
@@ -536,21 +1093,33 @@ double get_tmp(char *key, tmp_unit_t unit)
         return 0.0;
     }
 
-    // TODO: Create from_sp78() convert function
-    double tmp = result_smc.data[0];
+    return convert_tmp(from_sp78(result_smc.data), unit);
+}
 
-    switch (unit) {
-        case CELSIUS:
-            break;
-        case FAHRENHEIT:
-            tmp = to_fahrenheit(tmp);
-            break;
-        case KELVIN:
-            tmp = to_kelvin(tmp);
-            break;
+
+unsigned int get_tmps(const char *const keys[], unsigned int count,
+                      tmp_unit_t unit, double *tmps)
+{
+    unsigned int num_read = 0;
+    kern_return_t result;
+    smc_return_t  result_smc;
+
+    for (unsigned int i = 0; i < count; i++) {
+        result = read_smc(keys[i], &result_smc);
+
+        if (!(result == kIOReturnSuccess &&
+              result_smc.dataSize == 2   &&
+              result_smc.dataType == to_uint32_t(DATA_TYPE_SP78))) {
+            // Error - NAN so it can't be mistaken for a reading
+            tmps[i] = NAN;
+            continue;
+        }
+
+        tmps[i] = convert_tmp(from_sp78(result_smc.data), unit);
+        num_read++;
     }
 
-    return tmp;
+    return num_read;
 }
 
 
@@ -656,32 +1225,43 @@ int get_num_fans(void)
 
 unsigned int get_fan_rpm(unsigned int fan_num)
 {
-    char key[5];
-    kern_return_t result;
-    smc_return_t  result_smc;
+    return read_fan_rpm(fan_num, "Ac");
+}
 
-    sprintf(key, "F%dAc", fan_num);
-    result = read_smc(key, &result_smc);
 
-    if (!(result == kIOReturnSuccess &&
-          result_smc.dataSize == 2   &&
-          result_smc.dataType == to_uint32_t(DATA_TYPE_FPE2))) {
-        // Error
-        return 0;
-    }
+unsigned int get_fan_min_rpm(unsigned int fan_num)
+{
+    return read_fan_rpm(fan_num, "Mn");
+}
 
-    return from_fpe2(result_smc.data);
+
+unsigned int get_fan_max_rpm(unsigned int fan_num)
+{
+    return read_fan_rpm(fan_num, "Mx");
+}
+
+
+unsigned int get_fan_target_rpm(unsigned int fan_num)
+{
+    return read_fan_rpm(fan_num, "Tg");
 }
 
 
 bool set_fan_min_rpm(unsigned int fan_num, unsigned int rpm, bool auth)
 {
-    // TODO: Add rpm val safety check
     char key[5];
     bool ans = false;
     kern_return_t result;
     smc_return_t  result_smc;
 
+    // Never ask for more than the fan is rated for. Also catches a bad fan
+    // number, as there will be no max to read.
+    unsigned int max_rpm = get_fan_max_rpm(fan_num);
+
+    if (max_rpm == 0 || rpm > max_rpm) {
+        return false;
+    }
+
     memset(&result_smc, 0, sizeof(smc_return_t));
 
     // TODO: Don't use magic number